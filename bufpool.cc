@@ -0,0 +1,236 @@
+//****************************************************************************/
+// File:            bufpool.cc
+// Authors:         Sivasankar Radhakrishnan <sivasankar@cs.ucsd.edu>
+//****************************************************************************/
+
+/*
+ * Project Headers
+ */
+#include "common.h"
+
+
+//****************************************************************************/
+// Flags for Buffer Pools
+//****************************************************************************/
+
+DEFINE_bool(hugepages, true,
+            "Back buffer pools with huge pages when available");
+
+
+//****************************************************************************/
+// Macro Definitions
+//****************************************************************************/
+
+#define CACHE_LINE_SIZE     64
+#define HUGE_PAGE_SIZE      (2UL << 20)
+#define SLOT_NONE           0xffffffffU
+
+#define ROUND_UP(x, align)  (((x) + (align) - 1) & ~((size_t)(align) - 1))
+
+
+//****************************************************************************/
+// Local Function Declarations
+//****************************************************************************/
+
+static char *map_region(size_t size, int *backing);
+static void push_slot(struct buf_pool *pool, unsigned int slot);
+static unsigned int pop_slot(struct buf_pool *pool);
+static int buf_pool_slot_index(const struct buf_pool *pool, const char *buf);
+
+
+//****************************************************************************/
+// Function Definitions
+//****************************************************************************/
+
+/* Maps a region of the given size (a multiple of the page size).
+ * Regions spanning at least one huge page (and sized in multiples of it) try
+ * explicit huge pages first, then a huge page aligned anonymous mapping with
+ * transparent huge pages requested, and finally plain 4K pages.
+ */
+static char *map_region(size_t size, int *backing) {
+    char *region;
+
+    if (FLAGS_hugepages && size >= HUGE_PAGE_SIZE) {
+#ifdef MAP_HUGETLB
+        region = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                               -1, 0);
+        if (region != MAP_FAILED) {
+            *backing = BUF_POOL_HUGETLB;
+            return region;
+        }
+#endif
+
+#ifdef MADV_HUGEPAGE
+        /* Over-allocate so the region can be trimmed to a huge page boundary,
+         * otherwise THP cannot back the first and last partial huge pages.
+         */
+        char *raw = (char *) mmap(NULL, size + HUGE_PAGE_SIZE,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            region = (char *) ROUND_UP((unsigned long) raw, HUGE_PAGE_SIZE);
+            if (region > raw)
+                munmap(raw, region - raw);
+            if (region + size < raw + size + HUGE_PAGE_SIZE)
+                munmap(region + size, (raw + size + HUGE_PAGE_SIZE) -
+                                      (region + size));
+            if (madvise(region, size, MADV_HUGEPAGE) == 0) {
+                *backing = BUF_POOL_THP;
+                return region;
+            }
+            munmap(region, size);
+        }
+#endif
+    }
+
+    region = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        return NULL;
+    *backing = BUF_POOL_SMALL_PAGES;
+    return region;
+}
+
+/* The shared free list is a Treiber stack of slot indices. The head packs a
+ * generation tag in the upper 32 bits and (slot + 1) in the lower 32 bits so
+ * that a pop racing with a pop and push of the same slot fails its CAS.
+ */
+static void push_slot(struct buf_pool *pool, unsigned int slot) {
+    unsigned long long head = pool->head.load(std::memory_order_relaxed);
+    unsigned long long new_head;
+
+    do {
+        unsigned int top = (unsigned int) (head & 0xffffffffULL);
+        pool->next[slot].store(top ? top - 1 : SLOT_NONE,
+                               std::memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) | (slot + 1);
+    } while (!pool->head.compare_exchange_weak(head, new_head,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+}
+
+static unsigned int pop_slot(struct buf_pool *pool) {
+    unsigned long long head = pool->head.load(std::memory_order_acquire);
+    unsigned long long new_head;
+    unsigned int slot;
+
+    do {
+        unsigned int top = (unsigned int) (head & 0xffffffffULL);
+        if (top == 0)
+            return SLOT_NONE;
+        slot = top - 1;
+        unsigned int next = pool->next[slot].load(std::memory_order_relaxed);
+        new_head = (((head >> 32) + 1) << 32) |
+                   (next == SLOT_NONE ? 0 : next + 1);
+    } while (!pool->head.compare_exchange_weak(head, new_head,
+                                               std::memory_order_acquire,
+                                               std::memory_order_acquire));
+    return slot;
+}
+
+/* Carves num_slots buffers of at least slot_size bytes out of a single
+ * region. Slots are rounded up to a multiple of the cache line size so that
+ * every buffer starts on its own cache line.
+ */
+int buf_pool_init(struct buf_pool *pool, size_t slot_size, int num_slots) {
+    if (slot_size == 0 || num_slots <= 0) {
+        cerr << "Invalid buffer pool geometry" << endl;
+        return -1;
+    }
+
+    pool->slot_size = ROUND_UP(slot_size, CACHE_LINE_SIZE);
+    pool->num_slots = num_slots;
+    pool->region_size = pool->slot_size * num_slots;
+    /* Pools smaller than a huge page would waste most of one */
+    if (pool->region_size >= HUGE_PAGE_SIZE)
+        pool->region_size = ROUND_UP(pool->region_size, HUGE_PAGE_SIZE);
+    else
+        pool->region_size = ROUND_UP(pool->region_size, getpagesize());
+    pool->base = map_region(pool->region_size, &pool->backing);
+    if (pool->base == NULL) {
+        perror("mmap");
+        return -1;
+    }
+
+    pool->next = new std::atomic<unsigned int>[num_slots];
+    pool->head.store(0);
+    for (int i = num_slots - 1; i >= 0; i--)
+        push_slot(pool, i);
+
+    return 0;
+}
+
+void buf_pool_destroy(struct buf_pool *pool) {
+    if (pool->base != NULL)
+        munmap(pool->base, pool->region_size);
+    delete[] pool->next;
+    pool->base = NULL;
+    pool->next = NULL;
+}
+
+const char *buf_pool_backing_name(const struct buf_pool *pool) {
+    switch (pool->backing) {
+    case BUF_POOL_HUGETLB:
+        return "hugetlb pages";
+    case BUF_POOL_THP:
+        /* madvise() succeeding does not guarantee the kernel backs it */
+        return "transparent huge pages requested";
+    default:
+        return "4k pages";
+    }
+}
+
+/* Describes the whole pool as a single iovec, e.g. for registering it as a
+ * fixed buffer with io_uring or pinning it for zero-copy sends.
+ */
+void buf_pool_region(const struct buf_pool *pool, struct iovec *iov) {
+    iov->iov_base = pool->base;
+    iov->iov_len = pool->region_size;
+}
+
+static int buf_pool_slot_index(const struct buf_pool *pool, const char *buf) {
+    return (buf - pool->base) / pool->slot_size;
+}
+
+/* Each thread owns a buf_pool_cache and only touches the shared free list
+ * when its local cache runs empty or full, and then in batches.
+ */
+void buf_pool_cache_init(struct buf_pool_cache *cache, struct buf_pool *pool) {
+    cache->pool = pool;
+    cache->count = 0;
+}
+
+char *buf_pool_get(struct buf_pool_cache *cache) {
+    struct buf_pool *pool = cache->pool;
+
+    if (cache->count == 0) {
+        while (cache->count < BUF_POOL_CACHE_SIZE / 2) {
+            unsigned int slot = pop_slot(pool);
+            if (slot == SLOT_NONE)
+                break;
+            cache->slots[cache->count++] = slot;
+        }
+        if (cache->count == 0)
+            return NULL;
+    }
+
+    return pool->base + cache->slots[--cache->count] * pool->slot_size;
+}
+
+void buf_pool_put(struct buf_pool_cache *cache, char *buf) {
+    struct buf_pool *pool = cache->pool;
+
+    if (cache->count == BUF_POOL_CACHE_SIZE) {
+        while (cache->count > BUF_POOL_CACHE_SIZE / 2)
+            push_slot(pool, cache->slots[--cache->count]);
+    }
+
+    cache->slots[cache->count++] = buf_pool_slot_index(pool, buf);
+}
+
+/* Returns all buffers held in the cache to the shared free list */
+void buf_pool_cache_flush(struct buf_pool_cache *cache) {
+    while (cache->count > 0)
+        push_slot(cache->pool, cache->slots[--cache->count]);
+}
@@ -19,6 +19,8 @@ DEFINE_int32(rate_mbps, 0,
 DEFINE_int32(send_buff, (1 << 20), "Send buffer size in bytes");
 DEFINE_int32(send_size, 1472, "Size in bytes for each send() call");
 DEFINE_int32(mtu, 1500, "Interface MTU");
+DEFINE_string(dest_file, "",
+              "File with one destination host[:start_port[-end_port]] per line");
 
 
 //****************************************************************************/
@@ -27,29 +29,39 @@ DEFINE_int32(mtu, 1500, "Interface MTU");
 
 #define UDP_HEADER_SIZE     8
 #define IP_HEADER_SIZE      20
+#define IPV6_HEADER_SIZE    40
 #define ETH_HEADER_SIZE     14
 #define NSEC_PER_SEC        1000000000LLU
+#define CONNECT_RETRY_MSEC  100
+#define CONNECT_TIMEOUT_SEC 10
 
 
 //****************************************************************************/
 // Local Function Declarations
 //****************************************************************************/
 
-static inline int udp_bytes_on_wire(int write_size);
+static inline int udp_bytes_on_wire(int write_size, int ip_header_size);
 static unsigned long long timespec_diff_nsec(struct timespec *start,
                                              struct timespec *end);
 static unsigned long long spin_sleep_nsec(unsigned long long nsec,
                                           struct timespec *prev);
+static int load_dest_file(const char *path,
+                          vector<struct sockaddr_storage> &addrs);
+static bool is_ipv4_dest(const struct sockaddr_storage &addr);
+static int create_socket(int family);
+static int connect_all(vector<int> &sockfd,
+                       const vector<struct sockaddr_storage> &servaddr,
+                       const vector<socklen_t> &servaddr_len);
 
 
 //****************************************************************************/
 // Function Definitions
 //****************************************************************************/
 
-static inline int udp_bytes_on_wire(int write_size) {
-    int size_per_packet = FLAGS_mtu - IP_HEADER_SIZE - UDP_HEADER_SIZE;
+static inline int udp_bytes_on_wire(int write_size, int ip_header_size) {
+    int size_per_packet = FLAGS_mtu - ip_header_size - UDP_HEADER_SIZE;
     int num_packets = (write_size + size_per_packet - 1) / size_per_packet;
-    int total_header_size = UDP_HEADER_SIZE + IP_HEADER_SIZE + ETH_HEADER_SIZE;
+    int total_header_size = UDP_HEADER_SIZE + ip_header_size + ETH_HEADER_SIZE;
     return write_size + num_packets * total_header_size;
 }
 
@@ -81,18 +93,175 @@ static unsigned long long spin_sleep_nsec(unsigned long long nsec,
 }
 
 
+static int load_dest_file(const char *path,
+                          vector<struct sockaddr_storage> &addrs) {
+    ifstream in(path);
+    string line;
+
+    if (!in) {
+        cerr << "Unable to open destination file " << path << endl;
+        return -1;
+    }
+    while (getline(in, line)) {
+        /* Skip blank lines and comments */
+        size_t pos = line.find_first_not_of(" \t");
+        if (pos == string::npos || line[pos] == '#')
+            continue;
+        line = line.substr(pos, line.find_last_not_of(" \t\r") - pos + 1);
+        if (parse_destination(line.c_str(), addrs) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static bool is_ipv4_dest(const struct sockaddr_storage &addr) {
+    return addr.ss_family == AF_INET;
+}
+
+
+/* Creates a socket for the traffic mode with the client socket options set */
+static int create_socket(int family) {
+    int fd;
+
+    if (FLAGS_udp)
+        fd = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+    else
+        fd = socket(family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    /* Set send buffer size, socket priority, and non-blocking for TCP */
+    if (set_sendbuff_size(fd, FLAGS_send_buff) < 0 ||
+        set_sock_priority(fd, FLAGS_sk_prio) < 0 ||
+        (FLAGS_tcp && set_non_blocking(fd) < 0)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Connects a TCP socket to every destination and waits until all of them are
+ * established, so that a run only starts timing once traffic can flow.
+ * Refused connections, e.g. to a server still setting up its next run, are
+ * retried on a new socket every CONNECT_RETRY_MSEC for up to
+ * CONNECT_TIMEOUT_SEC.
+ */
+static int connect_all(vector<int> &sockfd,
+                       const vector<struct sockaddr_storage> &servaddr,
+                       const vector<socklen_t> &servaddr_len) {
+    enum { CONNECT_IDLE, CONNECT_PENDING, CONNECT_DONE };
+    int n = servaddr.size();
+    vector <int> state (n, CONNECT_IDLE);
+    vector <double> retry_time (n, 0);
+    double deadline = get_current_time() + CONNECT_TIMEOUT_SEC;
+    int num_connected = 0;
+
+    sockfd.assign(n, -1);
+    while (num_connected < n && !interrupted) {
+        vector <struct pollfd> fds;
+        vector <int> fd_dest;
+        double now = get_current_time();
+
+        if (now >= deadline) {
+            cerr << "Timed out connecting to " << n - num_connected
+                 << " destinations" << endl;
+            return -1;
+        }
+
+        /* Start connecting sockets that are due for an attempt */
+        for (int i=0; i < n; i++) {
+            if (state[i] == CONNECT_IDLE && now >= retry_time[i]) {
+                if (sockfd[i] < 0 &&
+                    (sockfd[i] = create_socket(servaddr[i].ss_family)) < 0)
+                    return -1;
+                if (connect(sockfd[i], (const struct sockaddr *)&servaddr[i],
+                            servaddr_len[i]) == 0) {
+                    state[i] = CONNECT_DONE;
+                    num_connected++;
+                } else if (errno == EINPROGRESS) {
+                    state[i] = CONNECT_PENDING;
+                } else if (errno == ECONNREFUSED) {
+                    close(sockfd[i]);
+                    sockfd[i] = -1;
+                    retry_time[i] = now + CONNECT_RETRY_MSEC / 1000.0;
+                } else {
+                    perror("connect");
+                    return -1;
+                }
+            }
+            if (state[i] == CONNECT_PENDING) {
+                struct pollfd pfd = { sockfd[i], POLLOUT, 0 };
+                fds.push_back(pfd);
+                fd_dest.push_back(i);
+            }
+        }
+
+        /* Wait for pending connections, or until the next retry is due */
+        if (poll(fds.data(), fds.size(), CONNECT_RETRY_MSEC) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return -1;
+        }
+
+        for (unsigned int j=0; j < fds.size(); j++) {
+            int i = fd_dest[j];
+            int err = 0;
+            socklen_t len = sizeof(err);
+
+            if (fds[j].revents == 0)
+                continue;
+            if (getsockopt(sockfd[i], SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                err = errno;
+            if (err == 0) {
+                state[i] = CONNECT_DONE;
+                num_connected++;
+            } else if (err == ECONNREFUSED) {
+                close(sockfd[i]);
+                sockfd[i] = -1;
+                state[i] = CONNECT_IDLE;
+                retry_time[i] = get_current_time() + CONNECT_RETRY_MSEC / 1000.0;
+            } else {
+                errno = err;
+                perror("connect");
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
 /* This function's interface allows it to be called directly or to start a
- * client thread through pthreads.
+ * client thread through pthreads. arg is a NULL terminated array of
+ * destination strings.
  */
 void *client_thread_main(void *arg) {
 
-    vector <int> sockfd (FLAGS_num_ports, 0);
-    struct sockaddr_in *servaddr;
+    char **dest_specs = (char **) arg;
+    vector <struct sockaddr_storage> servaddr;
+    vector <socklen_t> servaddr_len;
+    vector <int> sockfd;
+    int udp_sockfd[2] = {-1, -1};
+    int num_dests, num_ipv4_dests;
+    int family_start[2], family_count[2];
+    unsigned long long nsec[2] = {0, 0};
+    vector <struct mmsghdr> msgs[2];
+    vector <struct iovec> iovs;
+    int batch_size;
+    struct buf_pool pool;
+    struct buf_pool_cache cache;
+    struct iovec region;
+    vector <char *> bufs;
     char *buff;
-    unsigned long long nsec = 0;
-    char *server = (char*) arg;
-    double prev_stats_time = 0;
-    unsigned long long prev_total_bytes_out = 0;
+    double start_time, prev_stats_time = 0;
+    bool server_closed = false;
+    unsigned long long prev_total_bytes_out = get_total_bytes_out();
+    unsigned long long prev_total_pkts_out = get_total_pkts_out();
 
     /* Validate flags */
     if (FLAGS_tcp && FLAGS_rate_mbps) {
@@ -100,130 +269,251 @@ void *client_thread_main(void *arg) {
         exit(-1);
     }
 
-    /* Create a separate socket for each flow.
-     * In case of UDP, we will just use sockfd[0] to send traffic to all
-     * destinations.
+    /* Build the destination address table, one entry per destination port.
+     * IPv4 destinations are placed first so that each UDP batch only covers
+     * addresses of a single family.
      */
-    for (int i=0; i < FLAGS_num_ports; i++) {
-        if (FLAGS_udp) {
-            sockfd[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-        } else {
-            sockfd[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        }
-        if (sockfd[i] < 0) {
-            perror("socket");
-            return NULL;
-        }
-
-        /* Set send buffer size */
-        if (set_sendbuff_size(sockfd[i], FLAGS_send_buff) < 0)
-            return NULL;
-
-        /* Set socket priority */
-        if (set_sock_priority(sockfd[i], FLAGS_sk_prio) < 0)
-            return NULL;
-
-        /* Set socket to be non-blocking in case of TCP */
-        if (FLAGS_tcp) {
-            if (set_non_blocking(sockfd[i]) < 0)
-                return NULL;
-        }
+    for (int i=0; dest_specs != NULL && dest_specs[i] != NULL; i++) {
+        if (parse_destination(dest_specs[i], servaddr) < 0)
+            return THREAD_FAILED;
     }
-
-    /* Allocate server address objects */
-    servaddr = (struct sockaddr_in *) malloc(FLAGS_num_ports *
-                                             sizeof(struct sockaddr_in));
-    for (int i=0; i < FLAGS_num_ports; i++) {
-        bzero(&servaddr[i], sizeof(servaddr[i]));
-        servaddr[i].sin_family = AF_INET;
-        servaddr[i].sin_addr.s_addr = inet_addr(server);
-        servaddr[i].sin_port = htons(FLAGS_start_port + i);
+    if (!FLAGS_dest_file.empty()) {
+        if (load_dest_file(FLAGS_dest_file.c_str(), servaddr) < 0)
+            return THREAD_FAILED;
     }
-
-    /* For TCP mode, connect sockets to respective dst ports */
+    if (servaddr.empty()) {
+        cerr << "Specify server IP to connect to" << endl;
+        exit(-1);
+    }
+    stable_partition(servaddr.begin(), servaddr.end(), is_ipv4_dest);
+    num_dests = servaddr.size();
+    num_ipv4_dests = count_if(servaddr.begin(), servaddr.end(), is_ipv4_dest);
+    for (int i=0; i < num_dests; i++)
+        servaddr_len.push_back(sockaddr_len(&servaddr[i]));
+    family_start[0] = 0;
+    family_count[0] = num_ipv4_dests;
+    family_start[1] = num_ipv4_dests;
+    family_count[1] = num_dests - num_ipv4_dests;
+
+    /* Create a separate socket for each flow and connect it to its
+     * destination in case of TCP.
+     * In case of UDP, we will just use one socket per address family to send
+     * traffic to all destinations.
+     */
     if (FLAGS_tcp) {
-        for (int i=0; i < FLAGS_num_ports; i++) {
-            if (connect(sockfd[i], (const struct sockaddr *)&servaddr[i],
-                        sizeof servaddr[i])) {
-                if (errno != EINPROGRESS) {
-                    perror("connect");
-                    return NULL;
-                }
-            }
+        set_num_file_limit(num_dests);
+        if (connect_all(sockfd, servaddr, servaddr_len) < 0)
+            return THREAD_FAILED;
+    } else {
+        for (int f=0; f < 2; f++) {
+            if (family_count[f] == 0)
+                continue;
+            udp_sockfd[f] = create_socket(f ? AF_INET6 : AF_INET);
+            if (udp_sockfd[f] < 0)
+                return THREAD_FAILED;
         }
     }
 
-    /* Mmap the buffer to send data from */
-    buff = (char*) mmap(NULL, FLAGS_send_size, PROT_READ,
-                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-    if (buff == MAP_FAILED) {
-        perror("mmap");
-        return NULL;
-    }
-
-    /* Initialize variables for application level rate limiting if required */
-    if (FLAGS_rate_mbps > 0) {
-        nsec = udp_bytes_on_wire(FLAGS_send_size) * 8000LLU / FLAGS_rate_mbps;
+    /* Initialize variables for application level rate limiting if required.
+     * Rate limited sends go out one datagram at a time.
+     */
+    if (FLAGS_tcp) {
+        batch_size = 1;
+    } else if (FLAGS_rate_mbps > 0) {
+        nsec[0] = udp_bytes_on_wire(FLAGS_send_size, IP_HEADER_SIZE)
+                  * 8000LLU / FLAGS_rate_mbps;
+        nsec[1] = udp_bytes_on_wire(FLAGS_send_size, IPV6_HEADER_SIZE)
+                  * 8000LLU / FLAGS_rate_mbps;
+        batch_size = 1;
 
         printf("Sleeping for %lluns, sendbuff %d, send_size %d, prio %d\n",
-               nsec, FLAGS_send_buff, FLAGS_send_size, FLAGS_sk_prio);
+               nsec[family_count[0] > 0 ? 0 : 1], FLAGS_send_buff,
+               FLAGS_send_size, FLAGS_sk_prio);
     } else {
+        batch_size = FLAGS_batch_size;
+
         printf("App rate limiting disabled, sendbuff %d, "
                "send_size %d, prio %d\n",
                FLAGS_send_buff, FLAGS_send_size, FLAGS_sk_prio);
     }
+
+    /* Allocate one buffer per datagram of a UDP batch to send data from.
+     * TCP sends always use the first buffer.
+     */
+    if (buf_pool_init(&pool, FLAGS_send_size, batch_size) < 0)
+        return THREAD_FAILED;
+    buf_pool_cache_init(&cache, &pool);
+    for (int i=0; i < batch_size; i++) {
+        char *buf = buf_pool_get(&cache);
+        if (buf == NULL) {
+            cerr << "Unable to get send buffer from pool" << endl;
+            buf_pool_destroy(&pool);
+            return THREAD_FAILED;
+        }
+        bufs.push_back(buf);
+    }
+    buff = bufs[0];
+    buf_pool_region(&pool, &region);
+    printf("Buffer pool of %d x %zu bytes in a %zu byte region, %s\n",
+           pool.num_slots, pool.slot_size, region.iov_len,
+           buf_pool_backing_name(&pool));
     struct timespec prev_nsec;
     prev_nsec.tv_sec = 0;
     prev_nsec.tv_nsec = 0;
 
-    printf("Starting %d ports of %s traffic to %s\n",
-           FLAGS_num_ports, FLAGS_tcp ? "TCP" : "UDP", server);
+    /* Precompute message headers for batched UDP sends, per address family.
+     * Each table cycles through the family's destinations as many times as
+     * needed to fill a whole batch, so that even a single destination gets
+     * batch_size datagrams per sendmmsg() call while every destination
+     * still receives the same number of datagrams per sweep.
+     * Messages at the same position in a batch share a payload buffer.
+     */
+    if (FLAGS_udp) {
+        iovs.resize(batch_size);
+        for (int i=0; i < batch_size; i++) {
+            iovs[i].iov_base = bufs[i];
+            iovs[i].iov_len = FLAGS_send_size;
+        }
+        for (int f=0; f < 2; f++) {
+            int count = family_count[f];
+            if (count == 0)
+                continue;
+            msgs[f].resize(count * ((batch_size + count - 1) / count));
+            for (unsigned int j=0; j < msgs[f].size(); j++) {
+                int i = family_start[f] + j % count;
+                bzero(&msgs[f][j], sizeof(msgs[f][j]));
+                msgs[f][j].msg_hdr.msg_name = &servaddr[i];
+                msgs[f][j].msg_hdr.msg_namelen = servaddr_len[i];
+                msgs[f][j].msg_hdr.msg_iov = &iovs[j % batch_size];
+                msgs[f][j].msg_hdr.msg_iovlen = 1;
+            }
+        }
+    }
 
-    /* Store the start time for logging statistics */
-    prev_stats_time = get_current_time();
-    cout << "delta_t\trate_mbps_out" << endl;
+    printf("Starting %d flows of %s traffic to %d IPv4 and %d IPv6 "
+           "destinations\n", num_dests, FLAGS_tcp ? "TCP" : "UDP",
+           num_ipv4_dests, num_dests - num_ipv4_dests);
 
-    /* Send traffic to all dst ports */
-    while (!interrupted) {
+    /* Store the start time for logging statistics and timing the run */
+    start_time = prev_stats_time = get_current_time();
+    cout << "delta_t\trate_mbps_out\t"
+         << (FLAGS_tcp ? "calls_per_sec_out" : "pps_out") << endl;
+
+    /* Send traffic to all destinations */
+    while (!interrupted && !server_closed) {
         double current_time, diff_time;
-        for (int i=0; i < FLAGS_num_ports; i++) {
-            int ret;
-            /* For UDP, always send on same sockfd to all dst ports */
-            if (FLAGS_udp) {
-                ret = sendto(sockfd[0], buff, FLAGS_send_size, 0,
-                         (struct sockaddr *)&servaddr[i],
-                         sizeof(servaddr[i]));
-                /* For UDP continue sending even if there is no receiver and
-                 * sendto() fails.
+        bool expired;
+        if (FLAGS_udp) {
+            /* Send a batch of datagrams at a time, never mixing families.
+             * For UDP continue sending even if there is no receiver and
+             * sendmmsg() fails.
+             */
+            for (int f=0; f < 2; f++) {
+                int size = msgs[f].size();
+                int i = 0;
+                while (i < size) {
+                    int n = min(batch_size, size - i);
+                    int ret = sendmmsg(udp_sockfd[f], &msgs[f][i], n, 0);
+
+                    for (int j=0; j < ret; j++)
+                        add_to_total_bytes_out(msgs[f][i + j].msg_len);
+                    if (ret > 0)
+                        add_to_total_pkts_out(ret);
+
+                    if (FLAGS_rate_mbps > 0)
+                        spin_sleep_nsec(nsec[f], &prev_nsec);
+
+                    i += (ret > 0) ? ret : 1;
+                }
+            }
+        } else {
+            for (int i=0; i < num_dests; i++) {
+                int ret = send(sockfd[i], buff, FLAGS_send_size,
+                               MSG_NOSIGNAL);
+                /* In timed runs the server may finish its run first. A reset
+                 * before the first interval instead comes from a server
+                 * still ending its previous run, so reconnect and restart.
                  */
-                if (ret > 0)
-                    add_to_total_bytes_out(ret);
-
-                if (nsec > 0)
-                    spin_sleep_nsec(nsec, &prev_nsec);
-            } else {
-                ret = send(sockfd[i], buff, FLAGS_send_size, 0);
+                if (ret < 0 && FLAGS_duration > 0 &&
+                    (errno == ECONNRESET || errno == EPIPE ||
+                     errno == ECONNREFUSED)) {
+                    if (prev_stats_time != start_time) {
+                        cout << "Connection closed by server, ending run"
+                             << endl;
+                        server_closed = true;
+                        break;
+                    }
+                    cout << "Connection reset at start of run, reconnecting"
+                         << endl;
+                    for (int j=0; j < num_dests; j++) {
+                        if (sockfd[j] >= 0)
+                            close(sockfd[j]);
+                    }
+                    if (connect_all(sockfd, servaddr, servaddr_len) < 0)
+                        return THREAD_FAILED;
+                    start_time = prev_stats_time = get_current_time();
+                    prev_total_bytes_out = get_total_bytes_out();
+                    prev_total_pkts_out = get_total_pkts_out();
+                    break;
+                }
                 if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
                     perror("send");
-                    return NULL;
+                    return THREAD_FAILED;
+                }
+                if (ret > 0) {
+                    add_to_total_bytes_out(ret);
+                    add_to_total_pkts_out(1);
                 }
             }
         }
-        /* Check if stats must be shown */
+        /* Check if stats must be shown.
+         * Intervals are also cut at the end of warmup so that samples taken
+         * afterwards do not include any warmup traffic, and at the end of a
+         * timed run so that its last interval is not lost.
+         */
         current_time = get_current_time();
         diff_time = current_time - prev_stats_time;
-        if (diff_time >= 1.0) {
+        expired = run_expired(start_time, current_time);
+        bool warmup = in_warmup(start_time, prev_stats_time);
+        if (diff_time >= 1.0 ||
+            (warmup && !in_warmup(start_time, current_time)) || expired) {
             unsigned long long curr_bytes_out = get_total_bytes_out();
+            unsigned long long curr_pkts_out = get_total_pkts_out();
             double rate = ((curr_bytes_out - prev_total_bytes_out) * 8 / (1000000 * diff_time));
+            double pps = (curr_pkts_out - prev_total_pkts_out) / diff_time;
 
-            cout << "Tx";
+            cout << (warmup ? "Tx-warmup" : "Tx");
             cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(3) << diff_time;
-            cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << rate << endl;
+            cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << rate;
+            cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(0) << pps << endl;
+
+            if (!warmup)
+                record_interval_sample(rate, pps, diff_time);
 
             prev_stats_time = current_time;
             prev_total_bytes_out = curr_bytes_out;
+            prev_total_pkts_out = curr_pkts_out;
         }
+
+        if (expired)
+            break;
+    }
+
+    /* Close all sockets */
+    for (unsigned int i=0; i < sockfd.size(); i++) {
+        if (sockfd[i] >= 0)
+            close(sockfd[i]);
     }
+    for (int i=0; i < 2; i++) {
+        if (udp_sockfd[i] >= 0)
+            close(udp_sockfd[i]);
+    }
+
+    /* Release the send buffers */
+    for (unsigned int i=0; i < bufs.size(); i++)
+        buf_pool_put(&cache, bufs[i]);
+    buf_pool_cache_flush(&cache);
+    buf_pool_destroy(&pool);
 
     return NULL;
 }
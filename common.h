@@ -15,9 +15,11 @@ extern "C" {
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include <net/if.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,6 +30,7 @@ extern "C" {
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 }
@@ -35,9 +38,14 @@ extern "C" {
 /*
  * C++ Libraries
  */
+#include <algorithm>
+#include <atomic>
 #include <gflags/gflags.h>
 #include <iomanip>
+#include <fstream>
 #include <iostream>
+#include <numeric>
+#include <string>
 #include <vector>
 
 
@@ -51,6 +59,47 @@ DECLARE_bool(tcp);
 DECLARE_bool(udp);
 DECLARE_int32(start_port);
 DECLARE_int32(num_ports);
+DECLARE_int32(batch_size);
+DECLARE_int32(duration);
+DECLARE_int32(warmup);
+DECLARE_int32(repeat);
+DECLARE_bool(hugepages);
+
+
+//****************************************************************************/
+// Type Definitions
+//****************************************************************************/
+
+/* Returned by client and server thread main functions on failure */
+#define THREAD_FAILED           ((void *) -1)
+
+#define BUF_POOL_CACHE_SIZE     64
+
+enum buf_pool_backing {
+    BUF_POOL_SMALL_PAGES,
+    BUF_POOL_THP,
+    BUF_POOL_HUGETLB,
+};
+
+/* Pool of fixed-size, cache line aligned buffers carved out of one huge page
+ * backed region. Shared between threads through a lock-free free list.
+ */
+struct buf_pool {
+    char *base;
+    size_t region_size;
+    size_t slot_size;
+    int num_slots;
+    int backing;
+    std::atomic<unsigned long long> head;
+    std::atomic<unsigned int> *next;
+};
+
+/* Per-thread cache of free buffers in a buf_pool */
+struct buf_pool_cache {
+    struct buf_pool *pool;
+    int count;
+    unsigned int slots[BUF_POOL_CACHE_SIZE];
+};
 
 
 //****************************************************************************/
@@ -68,12 +117,33 @@ int set_non_blocking(int fd);
 int set_sendbuff_size(int sockfd, int size);
 int set_sock_priority(int sockfd, int prio);
 int set_reuseaddr(int sockfd);
+int set_ipv6_only(int sockfd, int on);
+socklen_t sockaddr_len(const struct sockaddr_storage *addr);
+int parse_destination(const char *spec, vector<struct sockaddr_storage> &addrs);
+void set_num_file_limit(int n);
 void *client_thread_main(void *arg);
 void *server_thread_main(void *arg);
 void add_to_total_bytes_in(int len);
 unsigned long long get_total_bytes_in();
 void add_to_total_bytes_out(int len);
 unsigned long long get_total_bytes_out();
+void add_to_total_pkts_in(int n);
+unsigned long long get_total_pkts_in();
+void add_to_total_pkts_out(int n);
+unsigned long long get_total_pkts_out();
 double get_current_time();
+int buf_pool_init(struct buf_pool *pool, size_t slot_size, int num_slots);
+void buf_pool_destroy(struct buf_pool *pool);
+const char *buf_pool_backing_name(const struct buf_pool *pool);
+void buf_pool_region(const struct buf_pool *pool, struct iovec *iov);
+void buf_pool_cache_init(struct buf_pool_cache *cache, struct buf_pool *pool);
+char *buf_pool_get(struct buf_pool_cache *cache);
+void buf_pool_put(struct buf_pool_cache *cache, char *buf);
+void buf_pool_cache_flush(struct buf_pool_cache *cache);
+bool in_warmup(double start_time, double now);
+bool run_expired(double start_time, double now);
+void record_interval_sample(double rate_mbps, double pps, double interval);
+int finish_run(int run);
+void print_aggregate_summary();
 
 #endif
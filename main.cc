@@ -21,6 +21,13 @@ DEFINE_int32(start_port, 5000,
              "Start port that client connects to, server listens on");
 DEFINE_int32(num_ports, 1,
              "Num ports that client connects to, server listens on");
+DEFINE_int32(batch_size, 32,
+             "Max UDP datagrams per sendmmsg() or recvmmsg() call");
+DEFINE_int32(duration, 0,
+             "Seconds to measure traffic for after warmup [0 = until interrupted]");
+DEFINE_int32(warmup, 0,
+             "Seconds at the start of each run excluded from the summary");
+DEFINE_int32(repeat, 1, "Number of timed runs to aggregate");
 
 //****************************************************************************/
 // Global Variable Declarations
@@ -29,6 +36,8 @@ DEFINE_int32(num_ports, 1,
 volatile bool interrupted;
 unsigned long long total_bytes_in = 0;
 unsigned long long total_bytes_out = 0;
+unsigned long long total_pkts_in = 0;
+unsigned long long total_pkts_out = 0;
 
 
 //****************************************************************************/
@@ -36,7 +45,6 @@ unsigned long long total_bytes_out = 0;
 //****************************************************************************/
 
 void handleint(int signum);
-void set_num_file_limit(int n);
 
 
 //****************************************************************************/
@@ -53,8 +61,14 @@ void set_num_file_limit(int n) {
 
     ret = getrlimit(RLIMIT_NOFILE, &rl);
     if (ret == 0) {
+        /* Never lower the limits, and only raise the hard limit (which
+         * requires privileges) when the soft limit cannot fit under it.
+         */
+        if (rl.rlim_cur >= (rlim_t) n + 1000)
+            return;
         rl.rlim_cur = n + 1000;
-        rl.rlim_max = n + 1000;
+        if (rl.rlim_max < rl.rlim_cur)
+            rl.rlim_max = rl.rlim_cur;
         ret = setrlimit(RLIMIT_NOFILE, &rl);
         if (ret != 0) {
             perror("setrlimit");
@@ -66,10 +80,13 @@ void set_num_file_limit(int n) {
     }
 }
 
+/* Returns seconds on a monotonic clock, for timing runs and intervals
+ * unaffected by wall clock steps.
+ */
 double get_current_time() {
-    struct timeval now;
-    gettimeofday(&now, NULL);
-    return (now.tv_sec + now.tv_usec/1000000.0);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec + now.tv_nsec/1000000000.0);
 }
 
 void add_to_total_bytes_in(int len) {
@@ -88,10 +105,28 @@ unsigned long long get_total_bytes_out() {
     return total_bytes_out;
 }
 
+void add_to_total_pkts_in(int n) {
+    total_pkts_in += n;
+}
+
+unsigned long long get_total_pkts_in() {
+    return total_pkts_in;
+}
+
+void add_to_total_pkts_out(int n) {
+    total_pkts_out += n;
+}
+
+unsigned long long get_total_pkts_out() {
+    return total_pkts_out;
+}
+
 int main(int argc, char *argv[]) {
 
+    int status = 0;
+
     string usage("This is a traffic generator for TCP and UDP traffic.\n"
-                 "Usage: %s [options] [server]");
+                 "Usage: %s [options] [server[:start_port[-end_port]] ...]");
     google::SetUsageMessage(usage);
     google::ParseCommandLineFlags(&argc, &argv, true);
 
@@ -106,14 +141,27 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
 
-    if ((FLAGS_c) && (argc != 2)) {
-        cerr << "Specify server IP to connect to" << endl;
-        exit(-1);
-    } else if ((FLAGS_s) && (argc > 1)) {
+    if ((FLAGS_s) && (argc > 1)) {
         cerr << "Extra command line arguments provided" << endl;
         exit(-1);
     }
 
+    if (FLAGS_batch_size <= 0) {
+        cerr << "Batch size must be positive" << endl;
+        exit(-1);
+    }
+
+    if (FLAGS_duration < 0 || FLAGS_warmup < 0) {
+        cerr << "Duration and warmup must not be negative" << endl;
+        exit(-1);
+    }
+
+    if (FLAGS_repeat < 1 || (FLAGS_repeat > 1 && FLAGS_duration == 0)) {
+        cerr << "Repeated runs require a positive repeat count and duration"
+             << endl;
+        exit(-1);
+    }
+
     /* Set file resource limits */
     set_num_file_limit(2*FLAGS_num_ports);
 
@@ -125,11 +173,26 @@ int main(int argc, char *argv[]) {
     signal(SIGPIPE, handleint);
     signal(SIGKILL, handleint);
 
-    /* Call server or client main function */
-    if (FLAGS_c)
-        client_thread_main(argv[1]);
-    else
-        server_thread_main(NULL);
+    /* Call server or client main function once per run.
+     * A failed run does not release its sockets and buffers, so no further
+     * runs are started after it.
+     */
+    for (int run=1; run <= FLAGS_repeat && !interrupted; run++) {
+        void *ret;
+        int num_samples;
+
+        if (FLAGS_c)
+            ret = client_thread_main(&argv[1]);
+        else
+            ret = server_thread_main(NULL);
+
+        num_samples = finish_run(run);
+        if (ret == THREAD_FAILED)
+            status = -1;
+        if (ret == THREAD_FAILED || num_samples == 0)
+            break;
+    }
+    print_aggregate_summary();
 
-    return 0;
+    return status;
 }
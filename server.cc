@@ -15,6 +15,8 @@
 
 DEFINE_int32(recv_size, 65536, "Max size in bytes for each recv() call");
 DEFINE_int32(listen_backlog, 1000, "Max listen backlog");
+DEFINE_bool(ipv6, false,
+            "Listen on IPv6 (dual-stack, also accepts IPv4 traffic)");
 
 
 //****************************************************************************/
@@ -24,25 +26,62 @@ DEFINE_int32(listen_backlog, 1000, "Max listen backlog");
 void *server_thread_main(void *arg) {
 
     vector <int> srvsockfd (FLAGS_num_ports, 0);
-    struct sockaddr_in *servaddr;
+    vector <struct sockaddr_storage> servaddr (FLAGS_num_ports);
+    int family = FLAGS_ipv6 ? AF_INET6 : AF_INET;
     vector <int> clisockfd;
     fd_set server_readfds;
     int server_fdmax = 0;
-    char *buff = (char *) malloc(FLAGS_recv_size);
-    double prev_stats_time = 0;
+    struct buf_pool pool;
+    struct buf_pool_cache cache;
+    struct iovec region;
+    int num_bufs = FLAGS_udp ? FLAGS_batch_size : 1;
+    vector <char *> bufs;
+    vector <struct iovec> iovs (num_bufs);
+    vector <struct mmsghdr> msgs (num_bufs);
+    char *buff;
+    double start_time = 0, prev_stats_time = 0;
+    bool active = false;
     unsigned long long prev_total_bytes_in = 0;
+    unsigned long long prev_total_pkts_in = 0;
+
+    /* Allocate the buffers to receive data into.
+     * UDP receives a batch of datagrams per recvmmsg() call, one buffer per
+     * datagram. TCP reads into a single buffer.
+     */
+    if (buf_pool_init(&pool, FLAGS_recv_size, num_bufs) < 0)
+        return THREAD_FAILED;
+    buf_pool_cache_init(&cache, &pool);
+    for (int i=0; i < num_bufs; i++) {
+        char *buf = buf_pool_get(&cache);
+        if (buf == NULL) {
+            cerr << "Unable to get receive buffer from pool" << endl;
+            buf_pool_destroy(&pool);
+            return THREAD_FAILED;
+        }
+        bufs.push_back(buf);
+        iovs[i].iov_base = buf;
+        iovs[i].iov_len = FLAGS_recv_size;
+        bzero(&msgs[i], sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    buff = bufs[0];
+    buf_pool_region(&pool, &region);
+    printf("Buffer pool of %d x %zu bytes in a %zu byte region, %s\n",
+           pool.num_slots, pool.slot_size, region.iov_len,
+           buf_pool_backing_name(&pool));
 
     /* Create separate listen sockets for each port */
     FD_ZERO(&server_readfds);
     for (int i=0; i < FLAGS_num_ports; i++) {
         if (FLAGS_udp) {
-            srvsockfd[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            srvsockfd[i] = socket(family, SOCK_DGRAM, IPPROTO_UDP);
         } else {
-            srvsockfd[i] = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            srvsockfd[i] = socket(family, SOCK_STREAM, IPPROTO_TCP);
         }
         if (srvsockfd[i] < 0) {
             perror("socket");
-            return NULL;
+            return THREAD_FAILED;
         }
 
         /* Set read FD flag */
@@ -50,11 +89,17 @@ void *server_thread_main(void *arg) {
 
         /* Set non-blocking flag */
         if (set_non_blocking(srvsockfd[i]) < 0)
-            return NULL;
+            return THREAD_FAILED;
 
         /* Set reuseaddr flag */
         if (set_reuseaddr(srvsockfd[i]) < 0)
-            return NULL;
+            return THREAD_FAILED;
+
+        /* Accept IPv4 traffic on IPv6 sockets too */
+        if (FLAGS_ipv6) {
+            if (set_ipv6_only(srvsockfd[i], 0) < 0)
+                return THREAD_FAILED;
+        }
 
         /* Set server_fdmax */
         if (server_fdmax < srvsockfd[i])
@@ -66,33 +111,38 @@ void *server_thread_main(void *arg) {
      * For UDP mode, add all the server sockets to the clisockfd set to later
      * read data from them.
      */
-    servaddr = (struct sockaddr_in *) malloc(FLAGS_num_ports *
-                                             sizeof(struct sockaddr_in));
     for (int i=0; i < FLAGS_num_ports; i++) {
         bzero(&servaddr[i], sizeof(servaddr[i]));
-        servaddr[i].sin_family = AF_INET;
-        servaddr[i].sin_addr.s_addr = INADDR_ANY;
-        servaddr[i].sin_port = htons(FLAGS_start_port + i);
+        if (FLAGS_ipv6) {
+            struct sockaddr_in6 *addr = (struct sockaddr_in6 *) &servaddr[i];
+            addr->sin6_family = AF_INET6;
+            addr->sin6_addr = in6addr_any;
+            addr->sin6_port = htons(FLAGS_start_port + i);
+        } else {
+            struct sockaddr_in *addr = (struct sockaddr_in *) &servaddr[i];
+            addr->sin_family = AF_INET;
+            addr->sin_addr.s_addr = INADDR_ANY;
+            addr->sin_port = htons(FLAGS_start_port + i);
+        }
 
         if (bind(srvsockfd[i], (struct sockaddr*) &servaddr[i],
-                 sizeof(struct sockaddr_in)) < 0) {
+                 sockaddr_len(&servaddr[i])) < 0) {
             perror("bind");
-            return NULL;
+            return THREAD_FAILED;
         }
 
         if (FLAGS_tcp) {
             if (listen(srvsockfd[i], FLAGS_listen_backlog) < 0) {
                 perror("listen");
-                return NULL;
+                return THREAD_FAILED;
             }
         } else {
             clisockfd.push_back(srvsockfd[i]);
         }
     }
 
-    /* Store the start time for logging statistics */
-    prev_stats_time = get_current_time();
-    cout << "delta_t\trate_mbps_in" << endl;
+    cout << "delta_t\trate_mbps_in\t"
+         << (FLAGS_tcp ? "calls_per_sec_in" : "pps_in") << endl;
 
     /* Accept incoming connections and receive traffic */
     while (!interrupted) {
@@ -100,6 +150,7 @@ void *server_thread_main(void *arg) {
         struct timeval timeout;
         fd_set server_readfds_tmp = server_readfds;
         double current_time, diff_time;
+        bool expired, client_left = false;
 
         timeout.tv_sec = 0;
         timeout.tv_usec = 100000; // check for interrupt at least every 100ms
@@ -109,13 +160,13 @@ void *server_thread_main(void *arg) {
                           NULL, NULL, &timeout)) < 0) {
             if (errno != EINTR) {
                 perror("select");
-                return NULL;
+                return THREAD_FAILED;
             } else {
                 continue;
             }
         } else if (ret == 0) {
-            /* Just timed out */
-            continue;
+            /* Just timed out, but still account for the idle time below */
+            FD_ZERO(&server_readfds_tmp);
         }
 
         /* For TCP, accept incoming connections on all listen ports */
@@ -125,15 +176,15 @@ void *server_thread_main(void *arg) {
                 continue;
 
             /* Accept all backlogged connections on the socket */
-            struct sockaddr_in client_addr;
-            socklen_t addrlen = sizeof(struct sockaddr_in);
+            struct sockaddr_storage client_addr;
 	        while (1) {
+                socklen_t addrlen = sizeof(client_addr);
                 int sd = accept(srvsockfd[i],
                                 (struct sockaddr *)&client_addr, &addrlen);
                 if (sd < 0) {
                     if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
                         perror("accept");
-                        return NULL;
+                        return THREAD_FAILED;
                     } else {
                         break;
                     }
@@ -158,17 +209,27 @@ void *server_thread_main(void *arg) {
             int ret;
 
             if (FLAGS_udp) {
-                struct sockaddr_in client_addr;
-                socklen_t addrlen;
-		        ret = recvfrom(clisockfd[i], buff, FLAGS_recv_size,
-                               MSG_DONTWAIT, (struct sockaddr*) &client_addr, &addrlen);
+                ret = recvmmsg(clisockfd[i], &msgs[0], num_bufs,
+                               MSG_DONTWAIT, NULL);
             } else {
                 ret = recv(clisockfd[i], buff, FLAGS_recv_size, MSG_DONTWAIT);
             }
 
+            /* Start timing the run and logging statistics at the first
+             * data received, so that idle time before clients start sending
+             * is not sampled.
+             */
+            if (ret > 0 && !active) {
+                active = true;
+                start_time = prev_stats_time = get_current_time();
+                prev_total_bytes_in = get_total_bytes_in();
+                prev_total_pkts_in = get_total_pkts_in();
+            }
+
             /* Check if the receive succeeded */
             if (ret == 0) {
                 /* Close the connection */
+                client_left = true;
                 close(clisockfd[i]);
                 FD_CLR(clisockfd[i], &server_readfds);
                 clisockfd.erase(clisockfd.begin() + i);
@@ -176,28 +237,68 @@ void *server_thread_main(void *arg) {
             } else if (ret < 0) {
                 if (errno != EAGAIN && errno != EWOULDBLOCK) {
                     perror("recv");
-                    return NULL;
+                    return THREAD_FAILED;
                 } else {
                     continue;
                 }
+            } else if (FLAGS_udp) {
+                /* ret is the number of datagrams received */
+                for (int j=0; j < ret; j++)
+                    add_to_total_bytes_in(msgs[j].msg_len);
+                add_to_total_pkts_in(ret);
             } else {
                 add_to_total_bytes_in(ret);
+                add_to_total_pkts_in(1);
             }
         }
 
-        /* Check if stats must be shown */
+        /* Nothing is sampled until clients send data */
+        if (!active)
+            continue;
+
+        /* Check if stats must be shown.
+         * Intervals are also cut at the end of warmup so that samples taken
+         * afterwards do not include any warmup traffic, at the end of a
+         * timed run so that its last interval is not lost, and when a
+         * client disconnects.
+         */
         current_time = get_current_time();
         diff_time = current_time - prev_stats_time;
-        if (diff_time >= 1.0) {
+        expired = run_expired(start_time, current_time);
+        bool warmup = in_warmup(start_time, prev_stats_time);
+        if (diff_time >= 1.0 ||
+            (warmup && !in_warmup(start_time, current_time)) || expired ||
+            client_left) {
             unsigned long long curr_bytes_in = get_total_bytes_in();
+            unsigned long long curr_pkts_in = get_total_pkts_in();
             double rate = ((curr_bytes_in - prev_total_bytes_in) * 8 / (1000000 * diff_time));
+            double pps = (curr_pkts_in - prev_total_pkts_in) / diff_time;
 
-            cout << "Rx";
+            cout << (warmup ? "Rx-warmup" : "Rx");
             cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(3) << diff_time;
-            cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << rate << endl;
+            cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << rate;
+            cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(0) << pps << endl;
+
+            if (!warmup)
+                record_interval_sample(rate, pps, diff_time);
 
             prev_stats_time = current_time;
             prev_total_bytes_in = curr_bytes_in;
+            prev_total_pkts_in = curr_pkts_in;
+        }
+
+        if (expired)
+            break;
+
+        /* A disconnecting client ends a timed run. An untimed server
+         * instead restarts timing, warmup included, at the next data
+         * received, e.g. from the client's next repeated run.
+         */
+        if (client_left) {
+            if (FLAGS_duration > 0)
+                break;
+            cout << "Client disconnected, restarting at next data" << endl;
+            active = false;
         }
     }
 
@@ -208,5 +309,11 @@ void *server_thread_main(void *arg) {
     for (unsigned int i=0; i < srvsockfd.size(); i++)
         close(srvsockfd[i]);
 
+    /* Release the receive buffers */
+    for (unsigned int i=0; i < bufs.size(); i++)
+        buf_pool_put(&cache, bufs[i]);
+    buf_pool_cache_flush(&cache);
+    buf_pool_destroy(&pool);
+
     return NULL;
 }
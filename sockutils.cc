@@ -55,3 +55,112 @@ int set_reuseaddr(int sockfd) {
         return 0;
     }
 }
+
+int set_ipv6_only(int sockfd, int on) {
+    if (setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on)) < 0) {
+        perror("setsockopt v6only");
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+socklen_t sockaddr_len(const struct sockaddr_storage *addr) {
+    if (addr->ss_family == AF_INET6)
+        return sizeof(struct sockaddr_in6);
+    else
+        return sizeof(struct sockaddr_in);
+}
+
+/* Parses a destination of the form host[:start_port[-end_port]], where an
+ * IPv6 host must be enclosed in brackets if a port is given, and appends one
+ * resolved address per destination port to addrs. Without an end port,
+ * FLAGS_num_ports ports are used starting at start_port (or
+ * FLAGS_start_port if no port is given).
+ */
+int parse_destination(const char *spec, vector<struct sockaddr_storage> &addrs) {
+    string host, ports;
+    bool has_ports = false;
+    string s(spec);
+    int start_port = FLAGS_start_port;
+    int end_port = FLAGS_start_port + FLAGS_num_ports - 1;
+    struct addrinfo hints, *res;
+    int ret;
+
+    if (s.size() > 0 && s[0] == '[') {
+        size_t close_pos = s.find(']');
+        if (close_pos == string::npos) {
+            cerr << "Missing ']' in destination " << spec << endl;
+            return -1;
+        }
+        host = s.substr(1, close_pos - 1);
+        if (close_pos + 1 < s.size()) {
+            if (s[close_pos + 1] != ':') {
+                cerr << "Invalid destination " << spec << endl;
+                return -1;
+            }
+            ports = s.substr(close_pos + 2);
+            has_ports = true;
+        }
+    } else if (s.find(':') != string::npos &&
+               s.find(':') == s.rfind(':')) {
+        host = s.substr(0, s.find(':'));
+        ports = s.substr(s.find(':') + 1);
+        has_ports = true;
+    } else {
+        /* Hostname, IPv4 address or bare IPv6 address */
+        host = s;
+    }
+
+    if (has_ports) {
+        const char *str = ports.c_str();
+        char *end;
+        long start, last;
+        bool valid;
+
+        /* Check the long values before narrowing them to ports */
+        errno = 0;
+        start = last = strtol(str, &end, 10);
+        valid = (end != str);
+        if (valid && *end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            valid = (end != str);
+        } else if (start > 0 && start <= 65535) {
+            last = start + FLAGS_num_ports - 1;
+        }
+        if (!valid || *end != '\0' || errno == ERANGE ||
+            start <= 0 || last > 65535 || start > last) {
+            cerr << "Invalid port range in destination " << spec << endl;
+            return -1;
+        }
+        start_port = start;
+        end_port = last;
+    }
+    if (start_port <= 0 || end_port > 65535 || start_port > end_port) {
+        cerr << "Invalid port range in destination " << spec << endl;
+        return -1;
+    }
+
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = FLAGS_udp ? SOCK_DGRAM : SOCK_STREAM;
+    if ((ret = getaddrinfo(host.c_str(), NULL, &hints, &res)) != 0) {
+        cerr << "getaddrinfo " << host << ": " << gai_strerror(ret) << endl;
+        return -1;
+    }
+
+    for (int port = start_port; port <= end_port; port++) {
+        struct sockaddr_storage addr;
+        bzero(&addr, sizeof(addr));
+        memcpy(&addr, res->ai_addr, res->ai_addrlen);
+        if (addr.ss_family == AF_INET6)
+            ((struct sockaddr_in6 *) &addr)->sin6_port = htons(port);
+        else
+            ((struct sockaddr_in *) &addr)->sin_port = htons(port);
+        addrs.push_back(addr);
+    }
+
+    freeaddrinfo(res);
+    return 0;
+}
@@ -0,0 +1,161 @@
+//****************************************************************************/
+// File:            stats.cc
+// Authors:         Sivasankar Radhakrishnan <sivasankar@cs.ucsd.edu>
+//****************************************************************************/
+
+/*
+ * Project Headers
+ */
+#include "common.h"
+
+
+//****************************************************************************/
+// Macro Definitions
+//****************************************************************************/
+
+/* Intervals cut short by the end of a run are not representative samples */
+#define MIN_SAMPLE_INTERVAL     0.5
+
+
+//****************************************************************************/
+// Local Variable Declarations
+//****************************************************************************/
+
+/* Interval samples of the current run, excluding warmup */
+static vector <double> interval_rate_mbps;
+static vector <double> interval_pps;
+
+/* Per-run means, aggregated across repeated runs */
+static vector <double> run_rate_mbps;
+static vector <double> run_pps;
+
+
+//****************************************************************************/
+// Local Function Declarations
+//****************************************************************************/
+
+static double t_critical_95(int df);
+static void print_summary_line(const char *name, const vector<double> &samples);
+
+
+//****************************************************************************/
+// Function Definitions
+//****************************************************************************/
+
+/* Two-sided 95% critical value of Student's t distribution.
+ * Exact for df <= 30, linearly interpolated in 1/df between the df = 30, 40,
+ * 60, 120 and infinity rows beyond that.
+ */
+static double t_critical_95(int df) {
+    static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    static const int large_df[] = { 30, 40, 60, 120 };
+    static const double large_t[] = { 2.042, 2.021, 2.000, 1.980, 1.960 };
+    int n = sizeof(table) / sizeof(table[0]);
+
+    if (df <= 0)
+        return 0;
+    if (df <= n)
+        return table[df - 1];
+
+    for (int i=1; i <= 4; i++) {
+        double lo = 1.0 / large_df[i - 1];
+        double hi = (i < 4) ? 1.0 / large_df[i] : 0.0;
+        if (i == 4 || df <= large_df[i]) {
+            double frac = (lo - 1.0 / df) / (lo - hi);
+            return large_t[i - 1] + frac * (large_t[i] - large_t[i - 1]);
+        }
+    }
+    return 1.960;
+}
+
+static void print_summary_line(const char *name, const vector<double> &samples) {
+    int n = samples.size();
+    double mean = 0, stddev = 0, ci;
+
+    for (int i=0; i < n; i++)
+        mean += samples[i];
+    mean /= n;
+
+    cout << name;
+    cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << mean;
+
+    /* Spread and confidence interval need at least two samples */
+    if (n < 2) {
+        cout << "\tn/a\tn/a\tn/a" << endl;
+        return;
+    }
+
+    for (int i=0; i < n; i++)
+        stddev += (samples[i] - mean) * (samples[i] - mean);
+    stddev = sqrt(stddev / (n - 1));
+    ci = t_critical_95(n - 1) * stddev / sqrt(n);
+
+    cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << stddev;
+    cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << mean - ci;
+    cout << "\t" << std::setiosflags(ios::fixed) << std::setprecision(2) << mean + ci;
+    cout << endl;
+}
+
+/* Returns true while start_time + warmup has not been reached */
+bool in_warmup(double start_time, double now) {
+    return (now - start_time) < FLAGS_warmup;
+}
+
+/* Returns true once a timed run has lasted warmup + duration seconds */
+bool run_expired(double start_time, double now) {
+    return (FLAGS_duration > 0 &&
+            now - start_time >= FLAGS_warmup + FLAGS_duration);
+}
+
+void record_interval_sample(double rate_mbps, double pps, double interval) {
+    if (interval < MIN_SAMPLE_INTERVAL)
+        return;
+    interval_rate_mbps.push_back(rate_mbps);
+    interval_pps.push_back(pps);
+}
+
+/* Prints mean, stddev and 95% confidence interval of the interval samples
+ * of the run that just finished, and saves the run means for aggregation.
+ * For TCP the message rate counts send()/recv() calls rather than packets,
+ * so it is left out of the summary.
+ * Returns the number of samples in the run.
+ */
+int finish_run(int run) {
+    int n = interval_rate_mbps.size();
+
+    if (n == 0) {
+        cout << "Run " << run << ": no samples collected" << endl;
+        return 0;
+    }
+
+    cout << "Run " << run << " summary over " << n << " intervals" << endl;
+    cout << "metric\tmean\tstddev\tci95_low\tci95_high" << endl;
+    print_summary_line("rate_mbps", interval_rate_mbps);
+    if (FLAGS_udp)
+        print_summary_line("pps", interval_pps);
+
+    run_rate_mbps.push_back(accumulate(interval_rate_mbps.begin(),
+                                       interval_rate_mbps.end(), 0.0) / n);
+    run_pps.push_back(accumulate(interval_pps.begin(),
+                                 interval_pps.end(), 0.0) / n);
+    interval_rate_mbps.clear();
+    interval_pps.clear();
+    return n;
+}
+
+/* Prints statistics of the per-run means across all repeated runs */
+void print_aggregate_summary() {
+    if (run_rate_mbps.size() < 2)
+        return;
+
+    cout << "Aggregate summary over " << run_rate_mbps.size() << " runs"
+         << endl;
+    cout << "metric\tmean\tstddev\tci95_low\tci95_high" << endl;
+    print_summary_line("rate_mbps", run_rate_mbps);
+    if (FLAGS_udp)
+        print_summary_line("pps", run_pps);
+}